@@ -0,0 +1,105 @@
+#include "check.h"
+#include "main.h"
+#include <iostream>
+#include <vector>
+#include <random>
+#include <chrono>
+
+using namespace std;
+
+//the eval the way it was before it was kept incrementally, every window rescanned cell by cell
+int referenceEval(BOARD rboard, BOARD yboard){
+    if(detectWin(rboard)) return INF;
+    if(detectWin(yboard)) return -INF;
+
+    auto cell = [](BOARD board, int row, int col){
+        return (int)((board >> (col * 7 + row)) & 1);
+    };
+    int score = 0;
+    //row step and col step of horizontal, vertical, / diagonal, \ diagonal windows
+    const int steps[4][2] = {{0, 1}, {1, 0}, {1, 1}, {1, -1}};
+    for(auto &step : steps){
+        for(int row = 0; row < 6; row++){
+            for(int col = 0; col < 7; col++){
+                int endRow = row + 3*step[0];
+                int endCol = col + 3*step[1];
+                if(endRow > 5 || endCol < 0 || endCol > 6) continue;
+                int rcount = 0, ycount = 0;
+                for(int i = 0; i < 4; i++){
+                    rcount += cell(rboard, row + i*step[0], col + i*step[1]);
+                    ycount += cell(yboard, row + i*step[0], col + i*step[1]);
+                }
+                if(rcount > 0 && ycount == 0)
+                    score += (rcount == 3) ? 10000 : (rcount == 2) ? 100 : 0;
+                else if(ycount > 0 && rcount == 0)
+                    score -= (ycount == 3) ? 10000 : (ycount == 2) ? 100 : 0;
+            }
+        }
+    }
+    for(int row = 0; row < 6; row++)
+        score += 10 * (cell(rboard, row, 3) - cell(yboard, row, 3));
+    return score;
+}
+
+int runChecks(int games){
+    Engine engine;
+    mt19937 rng(12345);
+    vector<Position> positions;
+    long mismatches = 0;
+
+    for(int g = 0; g < games; g++){
+        Position pos = Position(0, 0, &engine.zobrist);
+        while(!detectWin(pos.rboard) && !detectWin(pos.yboard)){
+            vector<int> legal;
+            for(int col = 0; col < 7; col++)
+                if(pos.isLegalMove(col)) legal.push_back(col);
+            if(legal.empty()) break;
+            int col = legal[rng() % legal.size()];
+
+            Position before = pos;
+            pos.playMove(col);
+            pos.evaluate();
+            if(pos.eval != referenceEval(pos.rboard, pos.yboard)) mismatches++;
+
+            //a position built straight from the boards must match one built move by move
+            Position built = Position(pos.rboard, pos.yboard, &engine.zobrist);
+            if(built.windowScore != pos.windowScore || built.hash != pos.hash) mismatches++;
+
+            Position undone = pos;
+            undone.undoMove(col);
+            if(undone.rboard != before.rboard || undone.yboard != before.yboard
+               || undone.windowScore != before.windowScore || undone.hash != before.hash)
+                mismatches++;
+
+            positions.push_back(pos);
+        }
+    }
+    cout << positions.size() << " positions from " << games << " playouts, " << mismatches << " mismatches\n";
+
+    //leaf cost: evaluate() alone, then making a child and evaluating it as minimax does at depth 1
+    long long sink = 0;
+    auto t0 = chrono::steady_clock::now();
+    for(Position &p : positions){
+        p.evaluate();
+        sink += p.eval;
+    }
+    auto t1 = chrono::steady_clock::now();
+    size_t made = 0;
+    for(Position &p : positions){
+        vector<Position*>* children = p.children();
+        for(Position* child : *children){
+            child->evaluate();
+            sink += child->eval;
+            delete child;
+            made++;
+        }
+        delete children;
+    }
+    auto t2 = chrono::steady_clock::now();
+    if(!positions.empty() && made != 0){
+        double evalNs = chrono::duration<double, nano>(t1 - t0).count() / positions.size();
+        double childNs = chrono::duration<double, nano>(t2 - t1).count() / made;
+        cout << "evaluate " << evalNs << " ns, child + evaluate " << childNs << " ns (" << sink % 7 << ")\n";
+    }
+    return mismatches == 0 ? 0 : 1;
+}
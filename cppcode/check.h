@@ -0,0 +1,9 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+//plays games random playouts and checks the incremental eval, undoMove and the position constructor
+//against a from scratch scan of the board after every move, then times evaluate() on the positions seen
+//returns 0 when everything matched
+int runChecks(int games);
+
+#endif
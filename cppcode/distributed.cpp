@@ -0,0 +1,504 @@
+#include "distributed.h"
+#include <cstdint>
+#include <string>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <csignal>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+using namespace std;
+
+/*
+Root splitting
+
+The coordinator expands the tree down to the split depth itself. Every position at the split depth
+becomes a job that is searched by a worker process with plain minimax. As jobs come back, their
+scores are folded into the expanded tree, which gives a lower and upper bound on the score of every
+expanded node. Those bounds are used in three ways:
+    - the window handed out with a new job is narrowed by the siblings of every node on its path that
+      are already known to reach some score, as alpha-beta would narrow it
+    - jobs whose window has closed can no longer change the result and are skipped
+    - young brothers wait: a node's younger siblings are only handed out once its eldest sibling is
+      fully searched, so they start with the eldest's score as their window instead of an open one
+
+Worker protocol, one line each way over a TCP connection to 127.0.0.1:
+    coordinator -> worker: "<moves> <depth> <alpha> <beta>\n"   (moves is "-" for the empty board)
+    worker -> coordinator: "<score>\n"
+*/
+
+#ifndef _WIN32
+
+enum{
+    JOB_PENDING, JOB_RUNNING, JOB_DONE, JOB_CUT
+};
+
+//one node of the tree the coordinator expands above the split depth
+struct SplitNode{
+    string moves;       //move string from the empty board to here
+    int parent;
+    int move;           //column played to reach this node
+    bool maximizing;    //red to move here
+    int depth;          //depth left to search from here
+    vector<int> kids;
+    int lo, hi;         //bounds on this node's minimax score known so far
+    int open;           //jobs below this node that are neither done nor cut
+    uint8_t state;      //leaves only
+};
+
+struct Coordinator{
+    vector<SplitNode> nodes;     //nodes[0] is the root, never resized once the jobs start
+    vector<int> leaves;          //jobs in move order
+    int inFlight = 0;
+    mutex mtx;
+    condition_variable cv;
+
+    int build(Position* pos, const string &moves, int parent, int move, int ply, int depth, int splitDepth);
+    void propagate(int node);
+    void closeJob(int leaf);
+    void windowFor(int leaf, int &alpha, int &beta);
+    bool mayStart(int leaf);
+    bool takeJob(int &leaf, int &alpha, int &beta);
+    void finishJob(int leaf, int alpha, int beta, int score);
+    void abandonJob(int leaf);
+    int pickBestMove();
+};
+
+int Coordinator::build(Position* pos, const string &moves, int parent, int move, int ply, int depth, int splitDepth){
+    int index = nodes.size();
+    SplitNode node;
+    node.moves = moves;
+    node.parent = parent;
+    node.move = move;
+    node.maximizing = pos->colorToMove() == RED;
+    node.depth = depth - ply;
+    node.lo = -INF;
+    node.hi = INF;
+    node.open = 0;
+    node.state = JOB_PENDING;
+    nodes.push_back(node);
+
+    //stop expanding where minimax would stop anyway, or at the split depth
+    bool gameOver = detectWin(pos->rboard) || detectWin(pos->yboard);
+    if(ply >= splitDepth || node.depth == 0 || gameOver){
+        leaves.push_back(index);
+        nodes[index].open = 1;
+        return index;
+    }
+
+    vector<Position*>* children = pos->children();
+    if(children->size() == 0){ //full board, let a worker score it like minimax would
+        leaves.push_back(index);
+        nodes[index].open = 1;
+    }
+    for(Position* child : *children){
+        int kid = build(child, moves + (char)('0' + child->mostRecentMove), index, child->mostRecentMove, ply + 1, depth, splitDepth);
+        nodes[index].kids.push_back(kid);
+        nodes[index].open += nodes[kid].open;
+        delete child;
+    }
+    delete children;
+    return index;
+}
+
+//recompute the bounds of every ancestor of node
+void Coordinator::propagate(int node){
+    for(int p = nodes[node].parent; p != -1; p = nodes[p].parent){
+        SplitNode &n = nodes[p];
+        n.lo = n.maximizing ? -INF : INF;
+        n.hi = n.maximizing ? -INF : INF;
+        for(int kid : n.kids){
+            if(n.maximizing){
+                n.lo = max(n.lo, nodes[kid].lo);
+                n.hi = max(n.hi, nodes[kid].hi);
+            }
+            else{
+                n.lo = min(n.lo, nodes[kid].lo);
+                n.hi = min(n.hi, nodes[kid].hi);
+            }
+        }
+    }
+}
+
+//a leaf is finished one way or another, its ancestors have one job less to wait for
+void Coordinator::closeJob(int leaf){
+    for(int n = leaf; n != -1; n = nodes[n].parent)
+        nodes[n].open--;
+}
+
+//the window for a job is what alpha-beta would pass down to it: every node on the path
+//narrows it with the scores its other children are already known to reach
+void Coordinator::windowFor(int leaf, int &alpha, int &beta){
+    vector<int> path;
+    for(int n = leaf; n != -1; n = nodes[n].parent)
+        path.push_back(n);
+    alpha = -INF;
+    beta = INF;
+    for(size_t i = path.size() - 1; i > 0; i--){
+        const SplitNode &p = nodes[path[i]];
+        for(int kid : p.kids){
+            if(kid == path[i - 1]) continue;
+            if(p.maximizing)
+                alpha = max(alpha, nodes[kid].lo);
+            else
+                beta = min(beta, nodes[kid].hi);
+        }
+    }
+}
+
+//young brothers wait: every node on the path is either the eldest child or its eldest sibling is finished
+bool Coordinator::mayStart(int leaf){
+    for(int n = leaf; nodes[n].parent != -1; n = nodes[n].parent){
+        int eldest = nodes[nodes[n].parent].kids[0];
+        if(n != eldest && nodes[eldest].open != 0) return false;
+    }
+    return true;
+}
+
+//blocks until there is a job to hand out, returns false once every job is done or cut
+//jobs go out in move order, a job given back by a lost worker is simply pending again
+bool Coordinator::takeJob(int &leaf, int &alpha, int &beta){
+    unique_lock<mutex> lock(mtx);
+    while(true){
+        leaf = -1;
+        bool cutAny = true;
+        while(leaf == -1 && cutAny){ //cutting a job may let its younger brothers go, so look again
+            cutAny = false;
+            for(int l : leaves){
+                if(nodes[l].state != JOB_PENDING || !mayStart(l)) continue;
+                windowFor(l, alpha, beta);
+                if(alpha >= beta){ //an ancestor is already settled without it
+                    nodes[l].state = JOB_CUT;
+                    closeJob(l);
+                    cutAny = true;
+                    continue;
+                }
+                leaf = l;
+                break;
+            }
+        }
+        if(leaf != -1){
+            nodes[leaf].state = JOB_RUNNING;
+            inFlight++;
+            return true;
+        }
+        //nothing can start yet, but a running job may finish, release its brothers, or fail and come back
+        if(inFlight == 0) return false;
+        cv.wait(lock);
+    }
+}
+
+void Coordinator::finishJob(int leaf, int alpha, int beta, int score){
+    lock_guard<mutex> lock(mtx);
+    SplitNode &n = nodes[leaf];
+    if(score <= alpha && alpha > -INF){ //failed low, only an upper bound
+        n.lo = -INF;
+        n.hi = alpha;
+    }
+    else if(score >= beta && beta < INF){ //failed high, only a lower bound
+        n.lo = beta;
+        n.hi = INF;
+    }
+    else{
+        n.lo = score;
+        n.hi = score;
+    }
+    n.state = JOB_DONE;
+    inFlight--;
+    closeJob(leaf);
+    propagate(leaf);
+    cv.notify_all();
+}
+
+void Coordinator::abandonJob(int leaf){
+    lock_guard<mutex> lock(mtx);
+    nodes[leaf].state = JOB_PENDING;
+    inFlight--;
+    cv.notify_all();
+}
+
+//the root move with the best guaranteed score, ties go to the earlier move in search order
+int Coordinator::pickBestMove(){
+    const SplitNode &root = nodes[0];
+    int best = root.kids[0];
+    for(int kid : root.kids){
+        if(root.maximizing ? nodes[kid].lo > nodes[best].lo : nodes[kid].hi < nodes[best].hi)
+            best = kid;
+    }
+    return nodes[best].move;
+}
+
+//writing to a worker that went away must fail the send, not kill the process with SIGPIPE
+//Linux takes a flag per send, macOS and the BSDs a socket option instead
+#ifdef MSG_NOSIGNAL
+const int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+const int SEND_FLAGS = 0;
+#endif
+
+void noSigPipe(int fd){
+#ifdef SO_NOSIGPIPE
+    int yes = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &yes, sizeof(yes));
+#endif
+}
+
+bool sendAll(int fd, const string &data){
+    size_t sent = 0;
+    while(sent < data.size()){
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, SEND_FLAGS);
+        if(n <= 0){
+            if(n == -1 && errno == EINTR) continue;
+            return false;
+        }
+        sent += n;
+    }
+    return true;
+}
+
+//reads up to the next '\n', keeping whatever came after it in buffer
+//with a timeout, gives up once it has passed and sets errno to ETIMEDOUT
+bool readLine(int fd, string &buffer, string &line, int timeoutMs = 0){
+    auto deadline = chrono::steady_clock::now() + chrono::milliseconds(timeoutMs);
+    size_t end;
+    while((end = buffer.find('\n')) == string::npos){
+        if(timeoutMs != 0){
+            auto left = chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now()).count();
+            pollfd waitFor = {fd, POLLIN, 0};
+            int ready = (left > 0) ? poll(&waitFor, 1, (int)left) : 0;
+            if(ready == -1 && errno == EINTR) continue;
+            if(ready == 0){
+                errno = ETIMEDOUT;
+                return false;
+            }
+            if(ready == -1) return false;
+        }
+        char chunk[256];
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if(n <= 0){
+            if(n == -1 && errno == EINTR) continue;
+            return false;
+        }
+        buffer.append(chunk, n);
+    }
+    line = buffer.substr(0, end);
+    buffer.erase(0, end + 1);
+    return true;
+}
+
+sockaddr_in localAddress(int port){
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return addr;
+}
+
+//port 0 picks any free port, see boundPort
+int listenOn(int port){
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(fd == -1) return -1;
+    int yes = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    sockaddr_in addr = localAddress(port);
+    if(bind(fd, (sockaddr*)&addr, sizeof(addr)) == -1 || listen(fd, 8) == -1){
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int boundPort(int fd){
+    sockaddr_in addr{};
+    socklen_t len = sizeof(addr);
+    getsockname(fd, (sockaddr*)&addr, &len);
+    return ntohs(addr.sin_port);
+}
+
+int connectWorker(int port, int retries){
+    for(int attempt = 0; attempt < retries; attempt++){
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if(fd == -1) return -1;
+        sockaddr_in addr = localAddress(port);
+        if(connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0){
+            noSigPipe(fd);
+            return fd;
+        }
+        close(fd);
+        this_thread::sleep_for(chrono::milliseconds(100 * (attempt + 1)));
+    }
+    return -1;
+}
+
+//answers jobs one connection at a time, the TT is kept between jobs
+void serveJobs(Engine &engine, int listenFd){
+    while(true){
+        int fd = accept(listenFd, nullptr, nullptr);
+        if(fd == -1){
+            if(errno == EINTR) continue;
+            return;
+        }
+        noSigPipe(fd);
+        string buffer, line;
+        while(readLine(fd, buffer, line)){
+            istringstream request(line);
+            string moves;
+            int depth, alpha, beta;
+            if(!(request >> moves >> depth >> alpha >> beta)) break;
+            //no node or time budget, a subtree cut short would return a meaningless score
+            Search search(&engine);
+            Position pos = engine.startPosition(moves == "-" ? "" : moves);
+            int score = minimax(search, &pos, depth, alpha, beta);
+            if(!sendAll(fd, to_string(score) + "\n")) break;
+        }
+        close(fd);
+    }
+}
+
+//feeds jobs to the worker on port until there are none left or the worker is lost
+//a worker that misses a job's deadline is dropped at once, reconnecting would only reach the same stalled process
+void workerLink(Coordinator* c, int port, int retries, int jobTimeoutMs){
+    int fd = -1;
+    int failures = 0; //failed jobs in a row
+    string buffer;
+    while(failures < retries){
+        if(fd == -1){
+            fd = connectWorker(port, retries);
+            buffer.clear();
+            if(fd == -1) break;
+        }
+        int leaf, alpha, beta;
+        if(!c->takeJob(leaf, alpha, beta)) break;
+
+        //nodes is not resized while jobs run, so reading it without the lock is safe
+        const SplitNode &n = c->nodes[leaf];
+        string request = (n.moves.empty() ? "-" : n.moves) + ' ' + to_string(n.depth) + ' '
+                         + to_string(alpha) + ' ' + to_string(beta) + '\n';
+        string reply;
+        int score = 0;
+        errno = 0;
+        bool ok = sendAll(fd, request) && readLine(fd, buffer, reply, jobTimeoutMs);
+        bool stalled = !ok && errno == ETIMEDOUT;
+        if(ok){
+            try{
+                score = stoi(reply);
+            } catch(...){
+                ok = false;
+            }
+        }
+
+        if(ok){
+            c->finishJob(leaf, alpha, beta, score);
+            failures = 0;
+        }
+        else{ //give the job back and try this worker again with a fresh connection
+            c->abandonJob(leaf);
+            close(fd);
+            fd = -1;
+            failures = stalled ? retries : failures + 1;
+        }
+    }
+    if(failures >= retries || fd == -1)
+        cerr << "Lost worker on port " << port << "\n";
+    if(fd != -1) close(fd);
+}
+
+int distributedBestMove(Engine &engine, Position pos, const string &moves, int depth, const SplitOptions &opts){
+    bool gameOver = detectWin(pos.rboard) || detectWin(pos.yboard);
+    vector<Position*>* rootChildren = pos.children();
+    bool noMoves = rootChildren->size() == 0;
+    for(Position* child : *rootChildren) delete child;
+    delete rootChildren;
+    if(depth < 1 || gameOver || noMoves){
+        Search search(&engine);
+        return bestMove(search, pos, depth);
+    }
+
+    Coordinator c;
+    c.build(&pos, moves, -1, -1, 0, depth, max(1, opts.splitDepth));
+
+    //fork local workers before any threads exist, each one inherits its own listening socket
+    vector<int> ports = opts.workerPorts;
+    vector<pid_t> spawned;
+    for(int i = 0; i < opts.spawnWorkers; i++){
+        int listenFd = listenOn(0);
+        if(listenFd == -1) continue;
+        int port = boundPort(listenFd);
+        pid_t pid = fork();
+        if(pid == 0){
+            serveJobs(engine, listenFd);
+            _exit(0);
+        }
+        close(listenFd);
+        if(pid > 0){
+            spawned.push_back(pid);
+            ports.push_back(port);
+        }
+    }
+
+    vector<thread> links;
+    for(int port : ports){
+        links.emplace_back(workerLink, &c, port, max(1, opts.connectRetries), max(0, opts.jobTimeoutMs));
+    }
+    for(thread &t : links){
+        t.join();
+    }
+
+    //anything the workers could not finish is searched here
+    int leaf, alpha, beta;
+    while(c.takeJob(leaf, alpha, beta)){
+        Search search(&engine);
+        Position jobPos = engine.startPosition(c.nodes[leaf].moves);
+        c.finishJob(leaf, alpha, beta, minimax(search, &jobPos, c.nodes[leaf].depth, alpha, beta));
+    }
+
+    for(pid_t pid : spawned){
+        kill(pid, SIGTERM);
+        waitpid(pid, nullptr, 0);
+    }
+
+    return c.pickBestMove();
+}
+
+int runWorker(int port, size_t maxTTBytes){
+    Engine engine(maxTTBytes);
+    int listenFd = listenOn(port);
+    if(listenFd == -1){
+        cerr << "Could not listen on port " << port << "\n";
+        return 1;
+    }
+    cout << "Worker listening on port " << boundPort(listenFd) << endl;
+    serveJobs(engine, listenFd);
+    close(listenFd);
+    return 0;
+}
+
+#else
+
+//sockets and fork are only wired up for POSIX (built and tested on Linux), fall back to a normal search
+int distributedBestMove(Engine &engine, Position pos, const string &moves, int depth, const SplitOptions &opts){
+    cerr << "Distributed search is not supported on this platform, searching locally\n";
+    Search search(&engine);
+    return bestMove(search, pos, depth);
+}
+
+int runWorker(int port, size_t maxTTBytes){
+    cerr << "Worker mode is not supported on this platform\n";
+    return 1;
+}
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include "main.h"
+#include <string>
+#include <vector>
+
+//settings for splitting one search across several worker engine processes
+struct SplitOptions{
+    int splitDepth = 1;            //plies expanded by the coordinator before handing subtrees to workers
+    std::vector<int> workerPorts;  //already running workers on 127.0.0.1 (see runWorker)
+    int spawnWorkers = 0;          //number of local workers to fork for this search
+    int connectRetries = 3;        //attempts to (re)connect to a worker before giving up on it
+    int jobTimeoutMs = 10000;      //a worker that has not answered a job by then is taken as stalled, 0 waits forever
+};
+
+//POSIX only, built and tested on Linux; on Windows both calls below say so on stderr and
+//distributedBestMove searches locally instead
+
+//searches pos to depth by farming the subtrees at opts.splitDepth out to workers
+//moves is the move string that produced pos, workers rebuild their positions from it
+//jobs ignore node and time budgets since a subtree cut short would return a meaningless score
+int distributedBestMove(Engine &engine, Position pos, const std::string &moves, int depth, const SplitOptions &opts);
+
+//serves subtree jobs on 127.0.0.1:port until killed, with its own engine
+int runWorker(int port, size_t maxTTBytes = 0);
+
+#endif
@@ -1,4 +1,7 @@
 #include "main.h"
+#include "distributed.h"
+#include "sessions.h"
+#include "check.h"
 #include <cstdint>
 #include <string>
 #include <iostream>
@@ -12,18 +15,54 @@
 #include <chrono>
 #include <thread>
 #include <future>
+#include <sstream>
 
 using namespace std;
 
-//zobrist uint64_t -> to TTEntry (seen in h file)
-unordered_map<BOARD, TTEntry*>* tt = new unordered_map<BOARD, TTEntry*>();
+//initialize the Zobrist table with random 64-bit numbers
+void ZobristTable::init() {
+    std::random_device rd;
+    std::mt19937_64 gen(rd());
+    std::uniform_int_distribution<uint64_t> dist;
+
+    for (int col = 0; col < 7; ++col) {
+        for (int row = 0; row < 6; ++row) {
+            for (int color = 0; color < 2; ++color) {
+                keys[col][row][color] = dist(gen);
+            }
+        }
+    }
+}
+
+Engine::Engine(size_t maxTTBytes){
+    this->maxTTBytes = maxTTBytes;
+    zobrist.init();
+}
+
+//rough heap cost of one table entry: the entry, the map node and its bucket
+const size_t TT_BYTES_PER_ENTRY = sizeof(TTEntry) + sizeof(pair<const BOARD, TTEntry*>) + 3 * sizeof(void*);
+
+//map buckets looked at for an entry to replace once the table is full
+const size_t TT_REPLACE_PROBES = 4;
 
-mutex TTmtx;
+Engine::~Engine(){
+    for(TTShard &shard : tt){
+        for(auto &pair : shard.entries){
+            delete pair.second;
+        }
+    }
+}
+
+//the top bits pick the stripe, the map hashes the whole key so every bit still spreads entries within it
+TTShard &Engine::shardFor(BOARD key){
+    return tt[key >> 58];
+}
 
-pair<TTEntry, bool> readTT(BOARD key){
-    lock_guard<mutex> lock(TTmtx);
-    auto it = tt->find(key);
-    if(it != tt->end()){
+pair<TTEntry, bool> Engine::readTT(BOARD key){
+    TTShard &shard = shardFor(key);
+    lock_guard<mutex> lock(shard.mtx);
+    auto it = shard.entries.find(key);
+    if(it != shard.entries.end()){
         return {*it->second, true};  //return the entry if found
     }
     else{
@@ -32,36 +71,102 @@ pair<TTEntry, bool> readTT(BOARD key){
     }
 }
 
-void writeTT(BOARD key, TTEntry val){
-    lock_guard<mutex> lock(TTmtx);
-    TTEntry* newVal = new TTEntry();
-    newVal->rboard = val.rboard;
-    newVal->yboard = val.yboard;
-    newVal->depth = val.depth;
-    newVal->score = val.score;
-    newVal->flag = val.flag;
-    newVal->bestMove = val.bestMove;
-    if((*tt).count(key) == 0)
-        (*tt)[key] = newVal;
+void Engine::writeTT(BOARD key, TTEntry val){
+    TTShard &shard = shardFor(key);
+    unordered_map<BOARD, TTEntry*> &entries = shard.entries;
+    lock_guard<mutex> lock(shard.mtx);
+    auto it = entries.find(key);
+    if(it != entries.end()){
+        //replace shallower results so iterative deepening sees the newest root move
+        if(val.depth >= it->second->depth)
+            *it->second = val;
+        return;
+    }
+    //each stripe gets an equal share of the budget
+    if(maxTTBytes == 0 || (entries.size() + 1) * TT_BYTES_PER_ENTRY * TT_SHARDS <= maxTTBytes){
+        entries[key] = new TTEntry(val);
+        return;
+    }
+
+    //the stripe is at its memory budget, make room by replacing an entry in the key's map bucket or the next few
+    //entries left by other searches go first, then the shallowest one as long as it is no deeper than the new entry
+    TTEntry* victim = nullptr;
+    BOARD victimKey = 0;
+    size_t bucket = entries.bucket(key);
+    for(size_t i = 0; i < TT_REPLACE_PROBES; i++){
+        size_t b = (bucket + i) % entries.bucket_count();
+        for(auto it = entries.begin(b); it != entries.end(b); ++it){
+            TTEntry* candidate = it->second;
+            bool stale = candidate->generation != val.generation;
+            bool better = victim == nullptr
+                || (stale && victim->generation == val.generation)
+                || (stale == (victim->generation != val.generation) && candidate->depth < victim->depth);
+            if(better){
+                victim = candidate;
+                victimKey = it->first;
+            }
+        }
+    }
+    if(victim == nullptr) return;
+    if(victim->generation == val.generation && victim->depth > val.depth) return;
+
+    //reuse the old allocation, the map keeps its size so nothing is rehashed
+    entries.erase(victimKey);
+    *victim = val;
+    entries[key] = victim;
+}
+
+size_t Engine::ttEntries(){
+    size_t entries = 0;
+    for(TTShard &shard : tt){
+        lock_guard<mutex> lock(shard.mtx);
+        entries += shard.entries.size();
+    }
+    return entries;
+}
+
+size_t Engine::ttBytes(){
+    return ttEntries() * TT_BYTES_PER_ENTRY;
 }
 
-//contains a random value for each color in each position to be used for hashing
-BOARD zobrist[7][6][2];
+//the position reached by playing moves from the empty board, hashed with this engine's keys
+Position Engine::startPosition(const string &moves){
+    Position pos = Position(0, 0, &zobrist);
+    pos.putStringIntoBoard(moves);
+    return pos;
+}
 
-//initialize the Zobrist table with random 64-bit numbers
-void initZobrist() {
-    std::random_device rd;
-    std::mt19937_64 gen(rd());
-    std::uniform_int_distribution<uint64_t> dist;
+Search::Search(Engine* engine, SearchLimits limits){
+    this->engine = engine;
+    this->limits = limits;
+    generation = engine->nextGeneration++;
+    start = chrono::steady_clock::now();
+}
 
-    for (int col = 0; col < 7; ++col) {
-        for (int row = 0; row < 6; ++row) {
-            for (int color = 0; color < 2; ++color) {
-                zobrist[col][row][color] = dist(gen);
-            }
+//counts a node and reports whether the search has to stop
+bool Search::outOfBudget(){
+    if(stopSearch) return true;
+    nodesSearched++;
+    if(limits.maxNodes != 0 && nodesSearched > limits.maxNodes){
+        stopSearch = true;
+    }
+    else if(sliceEnd != 0 && nodesSearched >= sliceEnd){
+        stopSearch = true;
+        sliceExpired = true;
+    }
+    else if((nodesSearched & 1023) == 0){ //checking the clock or other threads every node is too slow
+        if(cancel != nullptr && cancel->load(memory_order_relaxed)){
+            stopSearch = true;
+        }
+        else if(limits.maxTimeMs != 0){
+            auto elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start);
+            if(elapsed.count() >= limits.maxTimeMs)
+                stopSearch = true;
         }
     }
+    return stopSearch;
 }
+
 void TTEntry::print(){
     Position printPos = Position(rboard, yboard);
     printPos.printBoard();
@@ -163,11 +268,29 @@ void Position::playMove(int col){
     assert(row != -1); //makes sure the row isnt full
     mostRecentMove = col;
     int indexToPlace = getBitIndex(row, col);
+    windowScore += placementDelta(indexToPlace, toMove);
     if(toMove == RED)
         setIndexTo1(rboard, indexToPlace);
     else
         setIndexTo1(yboard, indexToPlace);
-    hash ^= zobrist[col][row][toMove];
+    if(zobrist != nullptr)
+        hash ^= zobrist->keys[col][row][toMove];
+}
+
+//takes back the top piece of col, the reverse of playMove
+void Position::undoMove(int col){
+    int row = rowOfNewPieceInCol(col);
+    row = (row == -1) ? 5 : row - 1;
+    assert(row >= 0); //makes sure the col isnt empty
+    int indexToRemove = getBitIndex(row, col);
+    int color = getBit(rboard, row, col) ? RED : YELLOW;
+    BOARD mask = ~(1ULL << indexToRemove);
+    rboard &= mask;
+    yboard &= mask;
+    windowScore -= placementDelta(indexToRemove, color);
+    if(zobrist != nullptr)
+        hash ^= zobrist->keys[col][row][color];
+    mostRecentMove = -1;
 }
 
 /*
@@ -273,12 +396,86 @@ int Position::opponentCanWinNextMove() {
     return -1; // no immediate winning move
 }
 
-#include <cstdint>
-#include <limits>
+const int score3 = 10000;
+const int score2 = 100;
+const int scoreCenter = 10;
+
+//every 4 cell window a line can be made in, and the windows each cell belongs to
+struct EvalTables{
+    BOARD windows[69];
+    uint8_t cellWindows[49][16]; //indexed by bit index
+    uint8_t cellWindowCount[49];
+};
+
+EvalTables buildEvalTables(){
+    EvalTables t = {};
+    int n = 0;
+    //row step and col step of horizontal, vertical, / diagonal, \ diagonal windows
+    const int steps[4][2] = {{0, 1}, {1, 0}, {1, 1}, {1, -1}};
+    for(auto &step : steps){
+        for(int row = 0; row < 6; ++row){
+            for(int col = 0; col < 7; ++col){
+                int endRow = row + 3*step[0];
+                int endCol = col + 3*step[1];
+                if(endRow > 5 || endCol < 0 || endCol > 6) continue;
+                BOARD mask = 0;
+                for(int i = 0; i < 4; ++i){
+                    int index = getBitIndex(row + i*step[0], col + i*step[1]);
+                    mask |= 1ULL << index;
+                    t.cellWindows[index][t.cellWindowCount[index]++] = n;
+                }
+                t.windows[n++] = mask;
+            }
+        }
+    }
+    assert(n == 69);
+    return t;
+}
+
+const EvalTables evalTables = buildEvalTables();
+
+//score of one window given how many red and yellow pieces are in it
+int windowValue(int rcount, int ycount){
+    if (rcount > 0 && ycount == 0) {
+        if (rcount == 3) return score3;
+        if (rcount == 2) return score2;
+    } else if (ycount > 0 && rcount == 0) {
+        if (ycount == 3) return -score3;
+        if (ycount == 2) return -score2;
+    }
+    return 0;
+}
+
+//change in windowScore from dropping a piece of color on the empty cell at index
+int Position::placementDelta(int index, int color){
+    int delta = 0;
+    for (int i = 0; i < evalTables.cellWindowCount[index]; ++i){
+        BOARD mask = evalTables.windows[evalTables.cellWindows[index][i]];
+        int rcount = __builtin_popcountll(rboard & mask);
+        int ycount = __builtin_popcountll(yboard & mask);
+        if (color == RED)
+            delta += windowValue(rcount + 1, ycount) - windowValue(rcount, ycount);
+        else
+            delta += windowValue(rcount, ycount + 1) - windowValue(rcount, ycount);
+    }
+    //center column bonus
+    if (index / 7 == 3)
+        delta += (color == RED) ? scoreCenter : -scoreCenter;
+    return delta;
+}
+
+//recompute windowScore from scratch, for positions not built up with playMove
+void Position::initEval(){
+    windowScore = 0;
+    for (BOARD mask : evalTables.windows){
+        windowScore += windowValue(__builtin_popcountll(rboard & mask), __builtin_popcountll(yboard & mask));
+    }
+    windowScore += __builtin_popcount((unsigned)getColumn(rboard, 3)) * scoreCenter;
+    windowScore -= __builtin_popcount((unsigned)getColumn(yboard, 3)) * scoreCenter;
+}
 
 void Position::evaluate(){
     // quick terminal checks
-    int myColor = colorToMove();
     if (detectWin(rboard)) {
         eval = INF;
         return;
@@ -287,100 +484,15 @@ void Position::evaluate(){
         eval = -INF;
         return;
     }
-    // else if (canWinNextMove() != -1){
-    //     eval = (myColor == RED) ? 100000 : -100000;
-    //     return;
-    // }
-    // else if (opponentCanWinNextMove() != -1){
-    //     eval = (myColor == RED) ? -50000 : 50000;
-    //     return;
-    // }
-
-    // base score
-    int score = 0;
-
-    const int score3 = 10000;
-    const int score2 = 100;
-    const int scoreCenter = 10;
-
-    // helper to score a window (4 bits in a small integer)
-    auto score_window = [&](unsigned rwin, unsigned ywin){
-        unsigned rcount = __builtin_popcount(rwin);
-        unsigned ycount = __builtin_popcount(ywin);
-
-        if (rcount > 0 && ycount == 0) {
-            if (rcount == 3) score += score3;
-            else if (rcount == 2) score += score2;
-        } else if (ycount > 0 && rcount == 0) {
-            if (ycount == 3) score -= score3;
-            else if (ycount == 2) score -= score2;
-        }
-    };
-
-    // horizontal windows
-    for (int row = 0; row < 6; ++row){
-        for (int col = 0; col < 4; ++col){
-            uint8_t rwindow = 0;
-            uint8_t ywindow = 0;
-            for (int i = 0; i < 4; ++i){
-                // getBit should return 0 or 1
-                rwindow = setBitAtIndex(rwindow, getBit(rboard, row, col+i), i);
-                ywindow = setBitAtIndex(ywindow, getBit(yboard, row, col+i), i);
-            }
-            score_window((unsigned)rwindow, (unsigned)ywindow);
-        }
-    }
-
-    // vertical windows
-    for (int row = 0; row < 3; ++row){
-        for (int col = 0; col < 7; ++col){
-            uint8_t rwindow = 0;
-            uint8_t ywindow = 0;
-            for (int i = 0; i < 4; ++i){
-                rwindow = setBitAtIndex(rwindow, getBit(rboard, row+i, col), i);
-                ywindow = setBitAtIndex(ywindow, getBit(yboard, row+i, col), i);
-            }
-            score_window((unsigned)rwindow, (unsigned)ywindow);
-        }
-    }
-
-    // / diagonal (down-right)
-    for (int row = 0; row < 3; ++row){
-        for (int col = 0; col < 4; ++col){
-            uint8_t rwindow = 0;
-            uint8_t ywindow = 0;
-            for (int i = 0; i < 4; ++i){
-                rwindow = setBitAtIndex(rwindow, getBit(rboard, row+i, col+i), i);
-                ywindow = setBitAtIndex(ywindow, getBit(yboard, row+i, col+i), i);
-            }
-            score_window((unsigned)rwindow, (unsigned)ywindow);
-        }
-    }
-
-    // \ diagonal (down-left)
-    for (int row = 0; row < 3; ++row){
-        for (int col = 3; col < 7; ++col){
-            uint8_t rwindow = 0;
-            uint8_t ywindow = 0;
-            for (int i = 0; i < 4; ++i){
-                rwindow = setBitAtIndex(rwindow, getBit(rboard, row+i, col-i), i);
-                ywindow = setBitAtIndex(ywindow, getBit(yboard, row+i, col-i), i);
-            }
-            score_window((unsigned)rwindow, (unsigned)ywindow);
-        }
-    }
 
-    // center column bonus
-    uint8_t rmid = getColumn(rboard, 3);
-    uint8_t ymid = getColumn(yboard, 3);
-    score += __builtin_popcount((unsigned)rmid) * scoreCenter;
-    score -= __builtin_popcount((unsigned)ymid) * scoreCenter;
+    // window and center scores are maintained incrementally by playMove
+    int score = windowScore;
 
     // clamp to INF bounds (avoid overflow)
     if (score > INF) score = INF;
     if (score < -INF) score = -INF;
 
-    eval = static_cast<int>(score);
+    eval = score;
 }
 
 
@@ -406,8 +518,7 @@ vector<Position*>* Position::children(uint8_t firstMove) {
     for (int col : finalOrder) {
         int count = __builtin_popcountll(getColumn(yboard, col) | getColumn(rboard, col));
         if (count < 6) {
-            Position* newPos = new Position(rboard, yboard);
-            newPos->hash = hash;
+            Position* newPos = new Position(*this);
             if (col < 0 || col >= 7) {
                 std::cerr << "Invalid child: col=" << col << "\n";
                 assert(false);
@@ -444,11 +555,13 @@ BOARD mirrorBoard(BOARD board) {
     return mirrored;
 }
 
-Position* mirrorPos(Position* pos) {
-    Position* mirrored = new Position();
-    mirrored->rboard = mirrorBoard(pos->rboard);
-    mirrored->yboard = mirrorBoard(pos->yboard);
-    mirrored->initHash();
+//copies pos rather than constructing from the boards, the eval is symmetric so it carries over without a rescan
+Position mirrorPos(Position* pos) {
+    Position mirrored = *pos;
+    mirrored.rboard = mirrorBoard(pos->rboard);
+    mirrored.yboard = mirrorBoard(pos->yboard);
+    mirrored.mostRecentMove = -1;
+    mirrored.initHash();
     return mirrored;
 }
 
@@ -465,20 +578,20 @@ int mirrorMove(int col) {
     return 6 - col; //mirror across center column
 }
 
-pair<TTEntry, bool> readTTOrMirror(Position* pos, Position* mirPos){
-    auto e = readTT(pos->hash);
-    auto eMir = readTT(mirPos->hash);
-
+pair<TTEntry, bool> readTTOrMirror(Engine &engine, Position* pos, Position* mirPos){
+    auto e = engine.readTT(pos->hash);
     if(e.second){ //if we found the entry, return it
         return {e.first, true};
     }
-    else if(eMir.second){ //if we did not find the entry, but did find its mirror, mirror the entry and return that
+
+    auto eMir = engine.readTT(mirPos->hash);
+    if(eMir.second){ //if we did not find the entry, but did find its mirror, mirror the entry and return that
         //return a TTEntry that has been mirrored
-        TTEntry* eCopy = new TTEntry(eMir.first);
-        eCopy->bestMove = mirrorMove(eCopy->bestMove);
-        eCopy->rboard = mirrorBoard(pos->rboard);
-        eCopy->yboard = mirrorBoard(pos->yboard);
-        return {*eCopy, true};
+        TTEntry eCopy = eMir.first;
+        eCopy.bestMove = mirrorMove(eCopy.bestMove);
+        eCopy.rboard = mirrorBoard(pos->rboard);
+        eCopy.yboard = mirrorBoard(pos->yboard);
+        return {eCopy, true};
     }
     return {TTEntry(), false};
 }
@@ -487,19 +600,30 @@ pair<TTEntry, bool> readTTOrMirror(Position* pos, Position* mirPos){
 //alpha is best score possible so far for maximizing player (red) at this level
 //beta is best score possible so far for minimizing player (yellow) at this level
 //minimax returns the best possible score that can be achieved for a given player from this position
-int minimax(Position* pos, int depth, int alpha, int beta){//, bool &printing){
+//rootMove, if given, receives the best move found at this node
+int minimax(Search &search, Position* pos, int depth, int alpha, int beta, int* rootMove){//, bool &printing){
+    //out of nodes or time, the caller throws this iteration away
+    if(search.outOfBudget()) return 0;
+
+    //the window this node was asked about, the TT flag has to be judged against it
+    //and not against alpha and beta after the search below has moved them
+    int alphaOrig = alpha;
+    int betaOrig = beta;
+
     bool isMaximizingPlayer = pos->colorToMove() == RED;
     //check in TT for this position or its mirror
-    Position* mirPos = mirrorPos(pos);
-    pair<TTEntry, bool> readE = readTTOrMirror(pos, mirPos);
+    Position mirPos = mirrorPos(pos);
+    pair<TTEntry, bool> readE = readTTOrMirror(*search.engine, pos, &mirPos);
     TTEntry* e = readE.second ? &readE.first : nullptr; 
 
     //use this entry only if it is for the same position as me, and if its depth is not lower than mine
+    //an entry from a search to the same depth is as good as searching again, which also lets a paused iteration skip what it already finished
     //make sure depth is not lower than mine because if my depth is higher, the search that put this entry into the table did not go deep enough to ensure i will get the same score if i search for myself
-    bool canUseThisEntry = e != nullptr && e->rboard == pos->rboard && e->yboard == pos->yboard && e->depth > depth;
+    bool canUseThisEntry = e != nullptr && e->rboard == pos->rboard && e->yboard == pos->yboard && e->depth >= depth;
     if (canUseThisEntry){
         //if we have already done exactly this, just stop the search down the tree and return the previously calculated score
         if (e->flag == EXACT) {
+            if (rootMove != nullptr) *rootMove = e->bestMove;
             return e->score;
         }
         //need to set alpha and not return because the search that put this entry in did not complete the search for this position, it was pruned
@@ -512,6 +636,7 @@ int minimax(Position* pos, int depth, int alpha, int beta){//, bool &printing){
         }
         //prune condition
         if (alpha >= beta) {
+            if (rootMove != nullptr) *rootMove = e->bestMove;
             return e->score;
         }
     }
@@ -536,6 +661,7 @@ int minimax(Position* pos, int depth, int alpha, int beta){//, bool &printing){
 
     //if the board is full, but there are no wins, return 0 for tie (cant be a win if the code reaches this point due to above return)
     if(children->size() == 0){
+        delete children;
         return 0;
     }
 
@@ -546,7 +672,7 @@ int minimax(Position* pos, int depth, int alpha, int beta){//, bool &printing){
         //for every child
         for(Position* child : *children){
             //minimax it
-            int childMinimax = minimax(child, depth-1, alpha, beta);
+            int childMinimax = minimax(search, child, depth-1, alpha, beta);
             //check the minimax against the current best and keep the best
             if(childMinimax > currentBest){
                 currentBest = childMinimax;
@@ -564,7 +690,7 @@ int minimax(Position* pos, int depth, int alpha, int beta){//, bool &printing){
         //for every child
         for(Position* child : *children){
             //minimax it
-            int childMinimax = minimax(child, depth-1, alpha, beta);
+            int childMinimax = minimax(search, child, depth-1, alpha, beta);
             //check the minimax against the current best and keep the best
             if(childMinimax < currentBest){
                 currentBest = childMinimax;
@@ -583,17 +709,23 @@ int minimax(Position* pos, int depth, int alpha, int beta){//, bool &printing){
     }
     delete children; //delete the vector itself
 
+    //the score of a cut off search is meaningless, keep it out of the table
+    if(search.stopSearch) return currentBest;
+
+    if(rootMove != nullptr) *rootMove = bestMove;
+
     //make table entry
     TTEntry newE;
     newE.rboard = pos->rboard;
     newE.yboard = pos->yboard;
     newE.depth = depth;
     newE.bestMove = bestMove;
+    newE.generation = search.generation;
 
-    if(currentBest <= alpha){
+    if(currentBest <= alphaOrig){
         newE.flag = UPPERBOUND;
     }
-    else if(currentBest >= beta){
+    else if(currentBest >= betaOrig){
         newE.flag = LOWERBOUND;
     }
     else{
@@ -601,7 +733,10 @@ int minimax(Position* pos, int depth, int alpha, int beta){//, bool &printing){
     }
 
     newE.score = currentBest;
-    writeTT(pos->hash, newE); //write it to table
+    search.engine->writeTT(pos->hash, newE); //write it to table
+
+    //a symmetric position is its own mirror, the mirrored entry would overwrite the real one with a flipped best move
+    if(mirPos.hash == pos->hash) return currentBest;
 
     //make mirrored table entry
     newE.rboard = mirrorBoard(pos->rboard);
@@ -609,10 +744,10 @@ int minimax(Position* pos, int depth, int alpha, int beta){//, bool &printing){
     newE.depth = depth;
     newE.bestMove = mirrorMove(bestMove);
 
-    if(currentBest <= alpha){
+    if(currentBest <= alphaOrig){
         newE.flag = UPPERBOUND;
     } 
-    else if(currentBest >= beta){
+    else if(currentBest >= betaOrig){
         newE.flag = LOWERBOUND;
     }
     else{
@@ -620,33 +755,65 @@ int minimax(Position* pos, int depth, int alpha, int beta){//, bool &printing){
     }
 
     newE.score = currentBest;
-    writeTT(mirPos->hash, newE); //write it to table
-
-    delete mirPos;
+    search.engine->writeTT(mirPos.hash, newE); //write it to table
 
     return currentBest;
 }
 
-int pickBestMoveFromRootTT(Position root) {
-    TTEntry e = readTT(root.hash).first; //get TT entry for root
+int pickBestMoveFromRootTT(Engine &engine, Position root) {
+    TTEntry e = engine.readTT(root.hash).first; //get TT entry for root
     if (e.rboard != root.rboard || e.yboard != root.yboard) {
         return -1; //TT might be empty
     }
     return e.bestMove; //move with best score
 }
 
-void threadWorker(int threadID, Position &root, int maxDepth) {
+void threadWorker(int threadID, Search &search, Position &root, int maxDepth) {
     //each thread runs minimax from the root at depths up to the desired depth
     for (int depth = 1; depth <= maxDepth; depth++) {
-        minimax(&root, depth, -INF, INF);
+        minimax(search, &root, depth, -INF, INF);
+    }
+}
+
+//runs one iteration of iterative deepening, false if the search had to stop before it finished
+bool deepen(Search &search, Position &pos, int depth, int &best) {
+    //the root move comes straight from the search, a shared or full TT may not hold the root
+    int move = -1;
+    minimax(search, &pos, depth, -INF, INF, &move);
+    if (search.stopSearch) {
+        if (!search.sliceExpired) //a paused iteration is not cut short, it carries on later
+            search.truncated = true;
+        return false;
     }
+    if (move >= 0 && move <= 6)
+        best = move;
+    search.completedDepth = depth;
+    return true;
 }
 
-int bestMove(Position pos, int depth) {
-    for (int d = depth; d <= depth; d++) {
-        minimax(&pos, d, -INF, INF);
+//the first legal move in search order, for when not even depth 1 finished
+int firstLegalMove(Position pos) {
+    int move = -1;
+    vector<Position*>* children = pos.children();
+    if (children->size() > 0)
+        move = (*children)[0]->mostRecentMove;
+    for (Position* child : *children) delete child;
+    delete children;
+    return move;
+}
+
+int bestMove(Search &search, Position pos, int depth) {
+    //with a budget, deepen one ply at a time so there is always a finished result to fall back on
+    bool budgeted = search.limits.maxNodes != 0 || search.limits.maxTimeMs != 0
+                    || search.engine->maxTTBytes != 0 || search.cancel != nullptr;
+    int best = -1;
+    for (int d = budgeted ? 1 : depth; d <= depth; d++) {
+        if (!deepen(search, pos, d, best))
+            break;
     }
-    return pickBestMoveFromRootTT(pos);
+    if (best == -1)
+        best = firstLegalMove(pos);
+    return best;
 }
 
 // int bestMove(Position pos, int depth){
@@ -668,19 +835,48 @@ int bestMove(Position pos, int depth) {
 //     return pickBestMoveFromRootTT(pos.hash);
 // }
 
+Position::Position(BOARD rboard, BOARD yboard, const ZobristTable* zobrist){
+    this->rboard = rboard;
+    this->yboard = yboard;
+    this->windowScore = 0;
+    this->mostRecentMove = -1;
+    this->zobrist = zobrist;
+    if(rboard != 0 || yboard != 0)
+        initEval();
+    initHash();
+}
+
 void Position::initHash(){
     hash = 0;
+    if(zobrist == nullptr) return;
     for(int col=0; col<7; col++){
         for(int row=0; row<6; row++){
             if(getBit(rboard, row, col))
-                hash ^= zobrist[col][row][0];
+                hash ^= zobrist->keys[col][row][0];
             else if(getBit(yboard, row, col))
-                hash ^= zobrist[col][row][1];
+                hash ^= zobrist->keys[col][row][1];
         }
     }
 }
 
+const size_t SESSION_TT_MB = 256; //--sessions default for --max-tt-mb, 0 there means unbounded
+
+const char* USAGE =
+    "usage: main.exe <moves> <depth> [flags]    best move for the position after moves, \"\" for the empty board\n"
+    "       main.exe --sessions <threads>       serve games on stdin, see sessions.h (TT capped at 256 MB by default)\n"
+    "       main.exe --worker <port>            serve root split jobs on 127.0.0.1:port\n"
+    "       main.exe --check <playouts>         check the incremental eval against a full rescan\n"
+    "flags: --max-nodes <n>  --max-time <ms>  --max-tt-mb <mb>\n"
+    "       --spawn <n>  --workers <p1,p2,...>  --split-depth <d>  --job-timeout <ms>\n"
+    "root splitting (--spawn, --workers) and --worker need POSIX sockets and fork and are only tested on Linux,\n"
+    "on Windows they print a warning and search locally in one process\n";
+
 int main(int argc, char* argv[]){
+    if(argc < 3){
+        cerr << USAGE;
+        return 1;
+    }
+
     //settings
     bool printRuntime = false;
     bool printBoard = true;
@@ -688,20 +884,87 @@ int main(int argc, char* argv[]){
     //start time
     auto start = std::chrono::high_resolution_clock::now();
 
-    int depth = stoi(argv[2]);
+    //optional flags after the first two arguments
+    //root splitting across worker processes:
+    //  --spawn <n>            fork n local workers for this search
+    //  --workers <p1,p2,...>  use workers already listening on these local ports
+    //  --split-depth <d>      plies to expand before handing subtrees to workers (default 1)
+    //  --job-timeout <ms>     drop a worker that takes longer than this on one job (default 10000, 0 waits forever)
+    //budgets, the search stops early with the deepest finished result:
+    //  --max-nodes <n>, --max-time <ms>, --max-tt-mb <mb>
+    SplitOptions split;
+    bool distributed = false;
+    SearchLimits limits;
+    size_t maxTTBytes = 0;
+    bool maxTTGiven = false;
+    for(int i = 3; i + 1 < argc; i += 2){
+        string flag = argv[i];
+        if(flag == "--spawn"){
+            split.spawnWorkers = stoi(argv[i+1]);
+            distributed = true;
+        }
+        else if(flag == "--workers"){
+            stringstream ports(argv[i+1]);
+            string port;
+            while(getline(ports, port, ',')){
+                split.workerPorts.push_back(stoi(port));
+            }
+            distributed = true;
+        }
+        else if(flag == "--split-depth"){
+            split.splitDepth = stoi(argv[i+1]);
+        }
+        else if(flag == "--job-timeout"){ //milliseconds
+            split.jobTimeoutMs = stoi(argv[i+1]);
+        }
+        else if(flag == "--max-nodes"){
+            limits.maxNodes = stoull(argv[i+1]);
+        }
+        else if(flag == "--max-time"){ //milliseconds
+            limits.maxTimeMs = stoi(argv[i+1]);
+        }
+        else if(flag == "--max-tt-mb"){
+            maxTTBytes = stoull(argv[i+1]) * 1024 * 1024;
+            maxTTGiven = true;
+        }
+    }
 
-    Position pos = Position(0, 0);
+    //worker mode: main.exe --worker <port>
+    if(argc >= 3 && string(argv[1]) == "--worker"){
+        return runWorker(stoi(argv[2]), maxTTBytes);
+    }
 
-    initZobrist();
-    pos.initHash();
+    //self check: main.exe --check <playouts>, see check.h
+    if(argc >= 3 && string(argv[1]) == "--check"){
+        return runChecks(stoi(argv[2]));
+    }
 
-    pos.putStringIntoBoard(argv[1]);
+    //session mode: main.exe --sessions <threads>, commands on stdin (see sessions.h)
+    //the TT is shared by every session for as long as the process runs, so it is bounded unless told otherwise
+    if(argc >= 3 && string(argv[1]) == "--sessions"){
+        Engine sessionEngine(maxTTGiven ? maxTTBytes : SESSION_TT_MB * 1024 * 1024);
+        return runSessions(sessionEngine, stoi(argv[2]), cin, cout);
+    }
+
+    Engine engine(maxTTBytes);
+
+    int depth = stoi(argv[2]);
+
+    Position pos = engine.startPosition(argv[1]);
     if(printBoard){
         pos.printBoard();
     }
-    cout << bestMove(pos, depth) <<'\n';
+    Search search(&engine, limits);
+    if(distributed)
+        cout << distributedBestMove(engine, pos, argv[1], depth, split) <<'\n';
+    else
+        cout << bestMove(search, pos, depth) <<'\n';
+
+    //stdout stays just the move, the server picks this up from stderr
+    if(search.truncated)
+        cerr << "truncated " << search.completedDepth << '\n';
 
-    //printTT(tt);
+    //for(TTShard &shard : engine.tt) printTT(&shard.entries);
 
     //end time
     auto end = std::chrono::high_resolution_clock::now();
@@ -1,7 +1,14 @@
+#ifndef MAIN_H
+#define MAIN_H
+
 #include <cstdint>
 #include <string>
 #include <iostream>
 #include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
 
 #define BOARD uint64_t
 
@@ -11,27 +18,35 @@ enum{
     RED, YELLOW
 };
 
+//a random value for each color in each cell, xored together to hash a position
+struct ZobristTable{
+    BOARD keys[7][6][2];
+    void init();
+};
+
 struct Position{
     BOARD rboard;
     BOARD yboard;
     int eval;
+    int windowScore; //non-terminal part of the eval, kept up to date by playMove and undoMove
     uint64_t hash;
     int mostRecentMove;
+    const ZobristTable* zobrist; //keys of the engine this position is searched by, no hashing when null
 
-    Position(BOARD rboard = 0, BOARD yboard = 0){
-        this->rboard = rboard;
-        this->yboard = yboard;
-        this->mostRecentMove = -1;
-    }
+    //eval and hash are computed from the boards, so any position built here is ready to search
+    Position(BOARD rboard = 0, BOARD yboard = 0, const ZobristTable* zobrist = nullptr);
     void printBoard();
     void placePieceAt(int row, int col, int color);
     int colorToMove();
     int rowOfNewPieceInCol(int col);
     void playMove(int col);
+    void undoMove(int col);
     void putStringIntoBoard(std::string sequence);
     void evaluate();
     bool isLegalMove(int col);
     void initHash();
+    void initEval();
+    int placementDelta(int index, int color);
     int opponentCanWinNextMove();
     int canWinNextMove();
     std::vector<Position*>* children(uint8_t firstMove = 255);
@@ -48,5 +63,65 @@ struct TTEntry {
     int score;         //score from minimax
     uint8_t flag;      //EXACT, LOWERBOUND, UPPERBOUND
     uint8_t bestMove;  //best move for ordering
+    uint16_t generation; //search that wrote it, entries from older searches are replaced first
     void print();
-};
\ No newline at end of file
+};
+
+//one stripe of the TT with its own lock, positions are spread over the stripes by hash
+//so searches on different threads rarely wait for each other
+struct TTShard{
+    std::unordered_map<BOARD, TTEntry*> entries; //zobrist hash -> entry
+    std::mutex mtx;
+};
+
+const int TT_SHARDS = 64;
+
+//one engine's state, several engines can live in one process
+//the TT is shared by every search running on the engine
+struct Engine{
+    TTShard tt[TT_SHARDS];
+    ZobristTable zobrist;
+    size_t maxTTBytes; //0 means unbounded
+    std::atomic<uint16_t> nextGeneration{0};
+
+    Engine(size_t maxTTBytes = 0);
+    ~Engine();
+    TTShard &shardFor(BOARD key);
+    std::pair<TTEntry, bool> readTT(BOARD key);
+    void writeTT(BOARD key, TTEntry val);
+    size_t ttEntries();
+    size_t ttBytes(); //estimated heap use of the table, what maxTTBytes is checked against
+    Position startPosition(const std::string &moves);
+};
+
+//hard limits for one search, 0 means unlimited
+struct SearchLimits{
+    uint64_t maxNodes = 0;
+    int maxTimeMs = 0;
+};
+
+//state of one search on an engine
+struct Search{
+    Engine* engine;
+    SearchLimits limits;
+    uint16_t generation; //tags the TT entries this search writes
+    const std::atomic<bool>* cancel = nullptr; //set from another thread to stop the search
+    uint64_t nodesSearched = 0;
+    bool stopSearch = false;
+    bool truncated = false;  //ran out of budget or was cancelled
+    int completedDepth = 0;  //deepest iteration finished
+    uint64_t sliceEnd = 0;   //pause once nodesSearched reaches this, 0 runs without pausing
+    bool sliceExpired = false; //stopped for sliceEnd, the iteration can be picked up again from the TT
+    std::chrono::steady_clock::time_point start;
+
+    Search(Engine* engine, SearchLimits limits = SearchLimits());
+    bool outOfBudget();
+};
+
+bool detectWin(BOARD board);
+int minimax(Search &search, Position* pos, int depth, int alpha, int beta, int* rootMove = nullptr);
+bool deepen(Search &search, Position &pos, int depth, int &best);
+int firstLegalMove(Position pos);
+int bestMove(Search &search, Position pos, int depth);
+
+#endif
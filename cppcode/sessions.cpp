@@ -0,0 +1,279 @@
+#include "sessions.h"
+#include <string>
+#include <sstream>
+#include <chrono>
+
+using namespace std;
+
+SessionManager::SessionManager(Engine* engine, int threads, ostream &out)
+    : engine(engine), out(out), pool(threads, threads - 1) {}
+
+//drop every search so the pool does not wait on them
+SessionManager::~SessionManager(){
+    lock_guard<mutex> lock(sessionsMtx);
+    for(auto &pair : sessions){
+        lock_guard<mutex> sessionLock(pair.second->mtx);
+        if(pair.second->job){
+            pair.second->job->discard = true;
+            pair.second->job->cancel = true;
+        }
+    }
+}
+
+shared_ptr<Session> SessionManager::find(const string &id){
+    lock_guard<mutex> lock(sessionsMtx);
+    auto it = sessions.find(id);
+    return (it != sessions.end()) ? it->second : nullptr;
+}
+
+void SessionManager::reply(const string &line){
+    lock_guard<mutex> lock(outMtx);
+    out << line << endl;
+}
+
+//the session is about to change, whatever its search finds would be for a stale position
+void dropSearch(Session &s){
+    if(s.job){
+        s.job->discard = true;
+        s.job->cancel = true;
+        s.job.reset();
+    }
+}
+
+//someone has four in a row or the board is full, there is nothing left to play or search
+bool gameOver(Position &pos){
+    if(detectWin(pos.rboard) || detectWin(pos.yboard)) return true;
+    for(int col = 0; col < 7; col++)
+        if(pos.isLegalMove(col)) return false;
+    return true;
+}
+
+bool SessionManager::handle(const string &line){
+    istringstream in(line);
+    string cmd, id;
+    in >> cmd;
+    if(cmd.empty()) return true;
+    if(cmd == "quit") return false;
+    if(cmd == "stats"){
+        size_t sessionCount;
+        {
+            lock_guard<mutex> lock(sessionsMtx);
+            sessionCount = sessions.size();
+        }
+        const size_t MB = 1024 * 1024;
+        reply("stats sessions " + to_string(sessionCount) + " tt " + to_string(engine->ttEntries())
+              + " ttmb " + to_string(engine->ttBytes() / MB) + " maxttmb " + to_string(engine->maxTTBytes / MB));
+        return true;
+    }
+
+    if(!(in >> id)){
+        reply("error - missing session id");
+        return true;
+    }
+
+    if(cmd == "new"){
+        string moves;
+        in >> moves;
+        auto s = make_shared<Session>();
+        s->pos = Position(0, 0, &engine->zobrist);
+        for(char c : moves){
+            if(gameOver(s->pos)){
+                reply("error " + id + " game over");
+                return true;
+            }
+            if(c < '0' || c > '6' || !s->pos.isLegalMove(c - '0')){
+                reply("error " + id + " illegal moves");
+                return true;
+            }
+            s->pos.playMove(c - '0');
+        }
+        s->moves = moves;
+        lock_guard<mutex> lock(sessionsMtx);
+        if(!sessions.emplace(id, s).second){
+            reply("error " + id + " already exists");
+            return true;
+        }
+        reply("ok " + id);
+        return true;
+    }
+
+    if(cmd == "close"){
+        shared_ptr<Session> s;
+        {
+            lock_guard<mutex> lock(sessionsMtx);
+            auto it = sessions.find(id);
+            if(it != sessions.end()){
+                s = it->second;
+                sessions.erase(it);
+            }
+        }
+        if(!s){
+            reply("error " + id + " no such session");
+            return true;
+        }
+        lock_guard<mutex> lock(s->mtx);
+        dropSearch(*s);
+        reply("ok " + id);
+        return true;
+    }
+
+    shared_ptr<Session> s = find(id);
+    if(!s){
+        reply("error " + id + " no such session");
+        return true;
+    }
+    lock_guard<mutex> lock(s->mtx);
+
+    if(cmd == "play"){
+        string col;
+        in >> col;
+        if(gameOver(s->pos)){
+            reply("error " + id + " game over");
+            return true;
+        }
+        if(col.size() != 1 || col[0] < '0' || col[0] > '6' || !s->pos.isLegalMove(col[0] - '0')){
+            reply("error " + id + " illegal move");
+            return true;
+        }
+        dropSearch(*s);
+        s->pos.playMove(col[0] - '0');
+        s->moves += col;
+        reply("ok " + id);
+    }
+    else if(cmd == "undo"){
+        if(s->moves.empty()){
+            reply("error " + id + " nothing to undo");
+            return true;
+        }
+        dropSearch(*s);
+        s->pos.undoMove(s->moves.back() - '0');
+        s->moves.pop_back();
+        reply("ok " + id);
+    }
+    else if(cmd == "go"){
+        int depth = 0;
+        in >> depth;
+        if(depth < 1){
+            reply("error " + id + " bad depth");
+            return true;
+        }
+        if(s->job){
+            reply("error " + id + " already searching");
+            return true;
+        }
+        if(gameOver(s->pos)){
+            reply("error " + id + " game over");
+            return true;
+        }
+        SearchLimits limits;
+        int priority = INTERACTIVE;
+        string option;
+        while(in >> option){
+            if(option == "interactive") priority = INTERACTIVE;
+            else if(option == "analysis") priority = ANALYSIS;
+            else if(option == "nodes") in >> limits.maxNodes;
+            else if(option == "time") in >> limits.maxTimeMs;
+        }
+        auto job = make_shared<SearchJob>(engine, limits);
+        job->sessionID = id;
+        job->session = s;
+        job->search.cancel = &job->cancel;
+        job->root = s->pos;
+        job->targetDepth = depth;
+        job->priority = priority;
+        s->job = job;
+        {
+            lock_guard<mutex> doneLock(doneMtx);
+            activeSearches++;
+        }
+        startSearch(job);
+    }
+    else if(cmd == "stop"){
+        if(s->job)
+            s->job->cancel = true;
+    }
+    else{
+        reply("error " + id + " unknown command " + cmd);
+    }
+    return true;
+}
+
+void SessionManager::startSearch(shared_ptr<SearchJob> job){
+    pool.submit([this, job]{ runSlice(job); }, job->priority);
+}
+
+//nodes a search runs before it goes to the back of the queue, around 10 ms
+const uint64_t SLICE_NODES = 10000;
+
+//a fixed number of nodes, then back of the queue so other sessions get a turn
+//a slice that ends part way through an iteration leaves the subtrees it finished in the TT and the next one starts that depth over
+void SessionManager::runSlice(shared_ptr<SearchJob> job){
+    Search &search = job->search;
+    //cancelled or out of time while it sat in the queue
+    auto waited = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - search.start);
+    if(job->cancel || (search.limits.maxTimeMs != 0 && waited.count() >= search.limits.maxTimeMs)){
+        search.truncated = true;
+        finishSearch(job);
+        return;
+    }
+    search.stopSearch = false;
+    search.sliceExpired = false;
+    search.sliceEnd = search.nodesSearched + SLICE_NODES;
+    bool finished = deepen(search, job->root, job->nextDepth, job->best);
+    if(search.sliceExpired){
+        startSearch(job);
+        return;
+    }
+    if(finished && job->nextDepth < job->targetDepth){
+        job->nextDepth++;
+        startSearch(job);
+        return;
+    }
+    finishSearch(job);
+}
+
+void SessionManager::finishSearch(shared_ptr<SearchJob> job){
+    reportSearch(job);
+    lock_guard<mutex> lock(doneMtx);
+    activeSearches--;
+    searchDone.notify_all();
+}
+
+void SessionManager::reportSearch(shared_ptr<SearchJob> job){
+    if(job->best == -1)
+        job->best = firstLegalMove(job->root);
+
+    shared_ptr<Session> s = job->session.lock();
+    if(!s) return;
+    lock_guard<mutex> lock(s->mtx);
+    if(job->discard) return;
+    if(s->job == job)
+        s->job.reset();
+    reply("bestmove " + job->sessionID + " " + to_string(job->best) + " " + to_string(job->search.completedDepth)
+          + (job->search.truncated ? " truncated" : ""));
+}
+
+//every search still running gets to report, a piped client would otherwise lose its answers
+void SessionManager::waitForSearches(bool stop){
+    if(stop){
+        lock_guard<mutex> lock(sessionsMtx);
+        for(auto &pair : sessions){
+            lock_guard<mutex> sessionLock(pair.second->mtx);
+            if(pair.second->job)
+                pair.second->job->cancel = true;
+        }
+    }
+    unique_lock<mutex> lock(doneMtx);
+    searchDone.wait(lock, [this]{ return activeSearches == 0; });
+}
+
+int runSessions(Engine &engine, int threads, istream &in, ostream &out){
+    SessionManager manager(&engine, threads, out);
+    string line;
+    bool quit = false;
+    while(!quit && getline(in, line)){
+        quit = !manager.handle(line);
+    }
+    manager.waitForSearches(quit);
+    return 0;
+}
@@ -0,0 +1,86 @@
+#ifndef SESSIONS_H
+#define SESSIONS_H
+
+#include "main.h"
+#include "threadpool.h"
+#include <string>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <iostream>
+#include <unordered_map>
+
+struct Session;
+
+//a search for one session, run as iterative deepening in slices of a fixed number of nodes per pool task
+//so searches from different sessions take turns on the pool however long an iteration gets
+struct SearchJob{
+    std::string sessionID;
+    std::weak_ptr<Session> session;
+    Search search;
+    Position root;
+    int targetDepth;
+    int nextDepth = 1;
+    int best = -1;
+    int priority;
+    std::atomic<bool> cancel{false};
+    std::atomic<bool> discard{false}; //the session moved on, do not report this result
+
+    SearchJob(Engine* engine, SearchLimits limits) : search(engine, limits) {}
+};
+
+//one game, with its position kept up to date move by move
+struct Session{
+    std::mutex mtx;
+    Position pos;
+    std::string moves; //so undo knows which column to take back
+    std::shared_ptr<SearchJob> job; //running search, if any
+};
+
+/*
+Line protocol on stdin/stdout, one command per line
+
+    new <id> [moves]                 -> ok <id>
+    play <id> <col>                  -> ok <id>
+    undo <id>                        -> ok <id>
+    go <id> <depth> [interactive|analysis] [nodes <n>] [time <ms>]
+                                     -> bestmove <id> <col> <depth reached> [truncated]   (once the search ends)
+    stop <id>                        -> the search reports what it has finished so far
+    close <id>                       -> ok <id>
+    stats                            -> stats sessions <n> tt <entries> ttmb <used> maxttmb <cap, 0 for none>
+    quit                             -> stops every search, each reports what it finished as truncated, then exits
+
+at the end of input every search runs on to its depth or budget and reports before the process exits
+
+play, undo and close drop any search still running on that session
+errors come back as: error <id> <reason>
+once someone has four in a row or the board is full, new, play and go answer: error <id> game over
+*/
+struct SessionManager{
+    Engine* engine;
+    std::mutex sessionsMtx;
+    std::unordered_map<std::string, std::shared_ptr<Session>> sessions;
+    std::mutex outMtx;
+    std::ostream &out;
+    std::mutex doneMtx;
+    std::condition_variable searchDone;
+    int activeSearches = 0; //started by go and not yet through finishSearch
+    ThreadPool pool; //last, so it is torn down before anything its tasks use
+
+    SessionManager(Engine* engine, int threads, std::ostream &out);
+    ~SessionManager();
+    bool handle(const std::string &line); //false once told to quit
+    std::shared_ptr<Session> find(const std::string &id);
+    void reply(const std::string &line);
+    void startSearch(std::shared_ptr<SearchJob> job);
+    void runSlice(std::shared_ptr<SearchJob> job);
+    void finishSearch(std::shared_ptr<SearchJob> job);
+    void reportSearch(std::shared_ptr<SearchJob> job);
+    void waitForSearches(bool stop); //stop cuts them short, otherwise they run to the end
+};
+
+//serves sessions from in until quit or end of input
+int runSessions(Engine &engine, int threads, std::istream &in, std::ostream &out);
+
+#endif
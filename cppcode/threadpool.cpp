@@ -0,0 +1,112 @@
+#include "threadpool.h"
+#include <algorithm>
+
+using namespace std;
+
+//pool and index of the pool thread running on this thread, if any
+thread_local ThreadPool* currentPool = nullptr;
+thread_local int currentWorker = -1;
+
+ThreadPool::ThreadPool(int threadCount, int maxAnalysisThreads){
+    maxAnalysis = max(1, min(maxAnalysisThreads, threadCount - 1));
+    threadCount = max(threadCount, maxAnalysis + 1);
+    for(int i = 0; i < threadCount; i++){
+        workers.push_back(make_unique<Worker>());
+    }
+    for(int i = 0; i < threadCount; i++){
+        threads.emplace_back(&ThreadPool::run, this, i);
+    }
+}
+
+//tasks already running finish, queued tasks that never started are dropped
+ThreadPool::~ThreadPool(){
+    {
+        lock_guard<mutex> lock(sleepMtx);
+        stopping = true;
+    }
+    wake.notify_all();
+    for(thread &t : threads){
+        t.join();
+    }
+}
+
+//tasks submitted by a pool thread go on its own queue, the rest are spread round robin
+//either way they are taken in submission order
+void ThreadPool::submit(function<void()> task, int priority){
+    int target = (currentPool == this) ? currentWorker : nextWorker++ % workers.size();
+    {
+        lock_guard<mutex> lock(workers[target]->mtx);
+        workers[target]->queues[priority].push_back({nextSeq++, move(task)});
+    }
+    signal();
+}
+
+//wakes a sleeping thread, a thread about to sleep sees the bump and looks again instead
+void ThreadPool::signal(){
+    lock_guard<mutex> lock(sleepMtx);
+    wakeups++;
+    wake.notify_one();
+}
+
+//oldest task of the highest priority across every queue
+bool ThreadPool::takeTask(int self, function<void()> &task, int &priority){
+    int n = workers.size();
+    for(priority = INTERACTIVE; priority <= ANALYSIS; priority++){
+        while(true){
+            //find the queue with the oldest front, starting with our own so ties stay local
+            int oldest = -1;
+            uint64_t oldestSeq = UINT64_MAX;
+            for(int i = 0; i < n; i++){
+                Worker &w = *workers[(self + i) % n];
+                lock_guard<mutex> lock(w.mtx);
+                if(!w.queues[priority].empty() && w.queues[priority].front().seq < oldestSeq){
+                    oldest = (self + i) % n;
+                    oldestSeq = w.queues[priority].front().seq;
+                }
+            }
+            if(oldest == -1) break;
+            //someone else may have taken it in the meantime, then look again
+            Worker &w = *workers[oldest];
+            lock_guard<mutex> lock(w.mtx);
+            if(!w.queues[priority].empty() && w.queues[priority].front().seq == oldestSeq){
+                //analysis only starts with a free slot, the task finishing in it signals when it frees up
+                if(priority == ANALYSIS){
+                    int running = runningAnalysis;
+                    do{
+                        if(running >= maxAnalysis) return false;
+                    } while(!runningAnalysis.compare_exchange_weak(running, running + 1));
+                }
+                task = move(w.queues[priority].front().run);
+                w.queues[priority].pop_front();
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void ThreadPool::run(int self){
+    currentPool = this;
+    currentWorker = self;
+    while(true){
+        uint64_t seen;
+        {
+            lock_guard<mutex> lock(sleepMtx);
+            if(stopping) return;
+            seen = wakeups;
+        }
+        function<void()> task;
+        int priority;
+        if(takeTask(self, task, priority)){
+            task();
+            if(priority == ANALYSIS){
+                runningAnalysis--;
+                signal(); //an analysis task may be waiting on this slot
+            }
+            continue;
+        }
+        //sleep until something is submitted or an analysis slot frees up after we looked
+        unique_lock<mutex> lock(sleepMtx);
+        wake.wait(lock, [&]{ return stopping || wakeups != seen; });
+    }
+}
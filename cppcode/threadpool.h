@@ -0,0 +1,52 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+
+enum{
+    INTERACTIVE, ANALYSIS
+};
+
+//fixed set of threads, each with its own queue per priority
+//every thread takes from every queue, oldest task first, so a task that requeues itself
+//goes behind everything submitted before it and not just behind its own queue
+//interactive tasks always go first
+struct ThreadPool{
+    struct Task{
+        uint64_t seq; //submission order across all queues
+        std::function<void()> run;
+    };
+    struct Worker{
+        std::mutex mtx;
+        std::deque<Task> queues[2]; //indexed by priority
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+    std::mutex sleepMtx;
+    std::condition_variable wake;
+    uint64_t wakeups = 0;                  //bumped under sleepMtx whenever there may be something new to run
+    std::atomic<unsigned> nextWorker{0};   //round robin for tasks submitted from outside the pool
+    std::atomic<uint64_t> nextSeq{0};
+    std::atomic<int> runningAnalysis{0};
+    int maxAnalysis;                       //analysis never takes every thread, so interactive work can always start
+    std::atomic<bool> stopping{false};
+
+    //threadCount is raised if needed so at least one thread is left over for interactive work
+    ThreadPool(int threadCount, int maxAnalysisThreads);
+    ~ThreadPool();
+    void submit(std::function<void()> task, int priority);
+    bool takeTask(int self, std::function<void()> &task, int &priority);
+    void signal();
+    void run(int self);
+};
+
+#endif
@@ -1,6 +1,7 @@
 const express = require('express');
 const cors = require('cors');
 const { execFile } = require('child_process');
+const os = require('os');
 const path = require('path');
 
 const app = express();
@@ -8,7 +9,129 @@ const PORT = 3000;
 
 const exePath = path.join(__dirname, 'engine');
 
-app.use(cors());
+//integer setting from the environment, the fallback only applies when it is unset or not a number so 0 can switch things off
+function envInt(name, fallback) {
+    const value = parseInt(process.env[name], 10);
+    return Number.isNaN(value) ? fallback : value;
+}
+
+//admission control, every engine run is one process busy on one core
+const MAX_RUNNING = envInt('ENGINE_MAX_RUNNING', os.cpus().length);
+const MAX_QUEUED = envInt('ENGINE_MAX_QUEUED', 4 * MAX_RUNNING);
+const QUEUE_TIMEOUT_MS = envInt('ENGINE_QUEUE_TIMEOUT_MS', 10000);
+//when requests are waiting, searches that start anyway are made this many plies shallower
+const DEGRADE_PLIES = envInt('ENGINE_DEGRADE_PLIES', 2);
+const MIN_DEPTH = envInt('ENGINE_MIN_DEPTH', 4);
+const MAX_DEPTH = envInt('ENGINE_MAX_DEPTH', 42);
+
+//per request budgets handed to the engine, it answers with its deepest finished search when one runs out
+//0 means unlimited, like the engine flags
+const ENGINE_MAX_TIME_MS = envInt('ENGINE_MAX_TIME_MS', 5000);
+const ENGINE_MAX_NODES = envInt('ENGINE_MAX_NODES', 0);
+const ENGINE_MAX_TT_MB = envInt('ENGINE_MAX_TT_MB', 256);
+
+let running = 0;
+const queue = []; //{ start, timer } waiting for a free slot
+
+function releaseSlot() {
+    running--;
+    const next = queue.shift();
+    if (next) {
+        clearTimeout(next.timer);
+        running++;
+        next.start();
+    }
+}
+
+//calls start once a slot is free, or returns false if the queue is full
+function admit(start, onTimeout) {
+    if (running < MAX_RUNNING) {
+        running++;
+        start();
+        return true;
+    }
+    if (queue.length >= MAX_QUEUED) {
+        return false;
+    }
+    const entry = { start };
+    entry.timer = setTimeout(() => {
+        queue.splice(queue.indexOf(entry), 1);
+        onTimeout();
+    }, QUEUE_TIMEOUT_MS);
+    queue.push(entry);
+    return true;
+}
+
+function engineArgs(moves, depth) {
+    const args = [moves, String(depth)];
+    if (ENGINE_MAX_TIME_MS > 0) {
+        args.push('--max-time', String(ENGINE_MAX_TIME_MS));
+    }
+    if (ENGINE_MAX_TT_MB > 0) {
+        args.push('--max-tt-mb', String(ENGINE_MAX_TT_MB));
+    }
+    if (ENGINE_MAX_NODES > 0) {
+        args.push('--max-nodes', String(ENGINE_MAX_NODES));
+    }
+    return args;
+}
+
+//result cache, keyed on the position rather than the move string so transpositions and mirror images share an entry
+const RESULT_CACHE_SIZE = envInt('RESULT_CACHE_SIZE', 10000);
+const resultCache = new Map(); //key -> engine output for the canonical orientation, in least recently used order
+const inFlight = new Map(); //key -> [{ res, mirrored }] waiting on the one engine run for that key
+const cacheStats = { hits: 0, mirrorHits: 0, coalesced: 0, misses: 0 };
+
+//board as one string of columns, bottom to top, plus the same for the mirror image (columns reversed like mirrorBoard)
+function canonicalPosition(moves) {
+    const columns = [[], [], [], [], [], [], []];
+    for (let i = 0; i < moves.length; i++) {
+        columns[moves.charCodeAt(i) - 48].push(i % 2 === 0 ? 'R' : 'Y');
+    }
+    const board = columns.map(c => c.join('')).join('/');
+    const mirror = columns.slice().reverse().map(c => c.join('')).join('/');
+    const overfull = columns.some(c => c.length > 6); //the engine asserts on a move into a full column
+    return mirror < board ? { board: mirror, mirrored: true, overfull } : { board, mirrored: false, overfull };
+}
+
+//flips engine output left to right: printed board rows and the move on its own line
+function mirrorOutput(stdout) {
+    return stdout.split('\n').map(line => {
+        if (/^[RY0]( [RY0]){6} ?$/.test(line)) {
+            return line.trim().split(' ').reverse().join(' ') + ' ';
+        }
+        if (/^[0-6]$/.test(line.trim())) {
+            return String(6 - parseInt(line, 10));
+        }
+        return line;
+    }).join('\n');
+}
+
+function cacheGet(key) {
+    const value = resultCache.get(key);
+    if (value !== undefined) { //move to the most recent end
+        resultCache.delete(key);
+        resultCache.set(key, value);
+    }
+    return value;
+}
+
+function cacheSet(key, value) {
+    resultCache.delete(key);
+    resultCache.set(key, value);
+    if (resultCache.size > RESULT_CACHE_SIZE) {
+        resultCache.delete(resultCache.keys().next().value);
+    }
+}
+
+function sendResult(res, result, mirrored, cacheStatus) {
+    res.set('X-Cache', cacheStatus);
+    res.set('X-Engine-Depth', String(result.depth));
+    res.set('X-Engine-Truncated', result.truncated ? '1' : '0');
+    res.send(mirrored ? mirrorOutput(result.stdout) : result.stdout);
+}
+
+app.use(cors({ exposedHeaders: ['X-Cache', 'X-Engine-Depth', 'X-Engine-Truncated'] }));
 
 //example URL: http://localhost:3000/run?arg1=hello&arg2=world
 app.get('/run', (req, res) => {
@@ -17,18 +140,96 @@ app.get('/run', (req, res) => {
     if (!arg1 || !arg2) {
         return res.status(400).send('Please provide both arg1 and arg2 in the query string.');
     }
+    const requestedDepth = parseInt(arg2, 10);
+    if (!/^[0-6]+$/.test(arg1) || !(requestedDepth > 0)) {
+        return res.status(400).send('arg1 must be a move string of columns 0-6 and arg2 a positive depth.');
+    }
 
-    //run the exe with the arguments
-    execFile(exePath, [arg1, arg2], (error, stdout, stderr) => {
-        if (error) {
-            console.error('Error:', error);
-            return res.status(500).send(`Error: ${error.message}`);
-        }
-        if (stderr) {
-            console.error('Stderr:', stderr);
+    const position = canonicalPosition(arg1);
+    if (position.overfull) {
+        return res.status(400).send('arg1 plays more than 6 pieces into a column.');
+    }
+    const key = `${position.board}:${Math.min(requestedDepth, MAX_DEPTH)}`;
+
+    const cached = cacheGet(key);
+    if (cached) {
+        cacheStats.hits++;
+        if (position.mirrored !== cached.searchedMirrored) cacheStats.mirrorHits++; //answered from the other orientation
+        return sendResult(res, cached, position.mirrored, 'HIT');
+    }
+
+    //someone is already searching this position, wait for their answer
+    const waiters = inFlight.get(key);
+    if (waiters) {
+        cacheStats.coalesced++;
+        waiters.push({ res, mirrored: position.mirrored });
+        return;
+    }
+    cacheStats.misses++;
+    inFlight.set(key, [{ res, mirrored: position.mirrored }]);
+
+    const finish = (respond) => {
+        const everyone = inFlight.get(key);
+        inFlight.delete(key);
+        everyone.forEach((waiter, i) => respond(waiter, i === 0 ? 'MISS' : 'COALESCED'));
+    };
+
+    const run = () => {
+        //shed depth while other requests are waiting so the queue drains
+        let depth = Math.min(requestedDepth, MAX_DEPTH);
+        if (queue.length > 0 && DEGRADE_PLIES > 0) {
+            depth = Math.max(Math.min(depth, MIN_DEPTH), depth - DEGRADE_PLIES);
         }
 
-        res.send(`${stdout}`);
+        //run the exe with the arguments, the kill is a backstop in case the engine overruns its own budget
+        const timeout = ENGINE_MAX_TIME_MS > 0 ? ENGINE_MAX_TIME_MS + 2000 : 0;
+        execFile(exePath, engineArgs(arg1, depth), { timeout }, (error, stdout, stderr) => {
+            releaseSlot();
+            if (error) {
+                console.error('Error:', error);
+                return finish(waiter => waiter.res.status(500).send(`Error: ${error.message}`));
+            }
+            //a stopped search reports the deepest depth it finished as "truncated <depth>"
+            const stopped = /^truncated (\d+)/m.exec(stderr);
+            const truncated = stopped !== null;
+            if (stderr && !truncated) {
+                console.error('Stderr:', stderr);
+            }
+
+            //stored the canonical way round, each waiter gets it flipped back to its own orientation
+            const result = {
+                stdout: position.mirrored ? mirrorOutput(stdout) : `${stdout}`,
+                depth: truncated ? parseInt(stopped[1], 10) : depth,
+                truncated,
+                searchedMirrored: position.mirrored,
+            };
+            //only full strength answers are worth keeping
+            if (!truncated && depth === Math.min(requestedDepth, MAX_DEPTH)) {
+                cacheSet(key, result);
+            }
+            finish((waiter, status) => sendResult(waiter.res, result, waiter.mirrored, status));
+        });
+    };
+
+    const busy = () => finish(waiter => waiter.res.status(503).set('Retry-After', '1').send('Engine busy, try again shortly.'));
+
+    if (!admit(run, busy)) {
+        busy();
+    }
+});
+
+//cache hit rates, for sizing RESULT_CACHE_SIZE
+app.get('/stats', (req, res) => {
+    const lookups = cacheStats.hits + cacheStats.coalesced + cacheStats.misses;
+    res.json({
+        ...cacheStats,
+        hitRate: lookups ? cacheStats.hits / lookups : 0,
+        coalescedRate: lookups ? cacheStats.coalesced / lookups : 0,
+        cacheSize: resultCache.size,
+        cacheCapacity: RESULT_CACHE_SIZE,
+        inFlight: inFlight.size,
+        running,
+        queued: queue.length,
     });
 });
 